@@ -0,0 +1,245 @@
+#!/usr/bin/env python3
+"""
+    File: trace_report.py
+
+    Turns the trace buffers sent by Trace::dump() (see trace.H) into a flat
+    profile of the sampled instruction pointers and a timeline of events.
+
+    The kernel writes the dump to the debug port 0xE9, along with the
+    console output. To capture it:
+
+      Bochs (port_e9_hack enabled in bochsrc.bxrc):
+          bochs -f bochsrc.bxrc -q > e9.out
+      QEMU:
+          qemu-system-i386 ... -debugcon file:e9.out
+
+    Then:
+          python3 trace_report.py e9.out --map kernel.map
+
+    kernel.map is written by the linker (see the makefile); without it,
+    the profile shows raw addresses.
+"""
+
+import argparse
+import bisect
+import re
+import shutil
+import struct
+import subprocess
+import sys
+
+MAGIC   = b"KTRC"
+TRAILER = b"CRTK"
+HEADER  = struct.Struct("<4sHHIIIII")
+EVENT   = struct.Struct("<QHHI")
+SAMPLE  = struct.Struct("<I")
+
+CONTEXT_SWITCH = 1
+PAGE_FAULT     = 2
+DISK_ISSUE     = 3
+DISK_COMPLETE  = 4
+FRAME_ALLOC    = 5
+FRAME_FREE     = 6
+
+EVENT_NAMES = {
+    CONTEXT_SWITCH: "context switch",
+    PAGE_FAULT:     "page fault",
+    DISK_ISSUE:     "disk issue",
+    DISK_COMPLETE:  "disk complete",
+    FRAME_ALLOC:    "frame alloc",
+    FRAME_FREE:     "frame free",
+}
+
+# --------------------------------------------------------------------------
+# READING THE DUMP
+# --------------------------------------------------------------------------
+
+class Dump:
+    def __init__(self, data, offset):
+        (_, version, event_size, n_events, self.lost_events,
+         n_samples, self.lost_samples, self.tick_cycles) = HEADER.unpack_from(data, offset)
+        if version != 1 or event_size != EVENT.size:
+            raise ValueError("unknown trace format (version %d, event size %d)"
+                             % (version, event_size))
+        pos = offset + HEADER.size
+        end = pos + n_events * EVENT.size + n_samples * SAMPLE.size
+        if data[end:end + len(TRAILER)] != TRAILER:
+            raise ValueError("trace at offset %d is incomplete" % offset)
+
+        self.events = [EVENT.unpack_from(data, pos + i * EVENT.size)
+                       for i in range(n_events)]
+        self.events.sort(key=lambda e: e[0])
+        pos += n_events * EVENT.size
+        self.samples = [SAMPLE.unpack_from(data, pos + i * SAMPLE.size)[0]
+                        for i in range(n_samples)]
+
+
+def read_dumps(path):
+    """Returns all complete dumps in the file, skipping the console output
+    around them."""
+    data = open(path, "rb").read()
+    dumps = []
+    offset = data.find(MAGIC)
+    while offset >= 0:
+        try:
+            dumps.append(Dump(data, offset))
+        except (ValueError, struct.error) as e:
+            print("warning: %s" % e, file=sys.stderr)
+        offset = data.find(MAGIC, offset + 1)
+    return dumps
+
+# --------------------------------------------------------------------------
+# SYMBOLS
+# --------------------------------------------------------------------------
+
+class Symbols:
+    """Function addresses from the linker map. The kernel is compiled with
+    -fleading-underscore, so every name carries an extra '_'."""
+
+    LINE = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+([A-Za-z_.$][\w.$]*)\s*$")
+
+    def __init__(self, path):
+        self.addresses = []
+        self.names = []
+        if path is None:
+            return
+        symbols = {}
+        for line in open(path, errors="replace"):
+            m = self.LINE.match(line)
+            if m:
+                address = int(m.group(1), 16)
+                if address != 0:
+                    symbols[address] = m.group(2)
+        for address in sorted(symbols):
+            self.addresses.append(address)
+            self.names.append(symbols[address])
+        self.names = demangle(self.names)
+
+    def lookup(self, address):
+        i = bisect.bisect_right(self.addresses, address) - 1
+        if i < 0:
+            return "0x%08x" % address
+        return self.names[i]
+
+
+def demangle(names):
+    names = [n[1:] if n.startswith("_") else n for n in names]
+    if not names or shutil.which("c++filt") is None:
+        return names
+    out = subprocess.run(["c++filt"], input="\n".join(names), capture_output=True,
+                         text=True).stdout.split("\n")
+    return out[:len(names)] if len(out) >= len(names) else names
+
+# --------------------------------------------------------------------------
+# REPORTS
+# --------------------------------------------------------------------------
+
+def flat_profile(dump, symbols, limit):
+    counts = {}
+    for eip in dump.samples:
+        name = symbols.lookup(eip)
+        counts[name] = counts.get(name, 0) + 1
+    total = len(dump.samples)
+    print("FLAT PROFILE: %d samples (%d lost)" % (total, dump.lost_samples))
+    if total == 0:
+        return
+    print("   %time  samples  function")
+    ranked = sorted(counts.items(), key=lambda kv: -kv[1])
+    for name, n in ranked[:limit]:
+        print("  %5.1f  %7d  %s" % (100.0 * n / total, n, name))
+    print()
+
+
+def describe(event, pending_disk):
+    _, type, a, b = event
+    if type == CONTEXT_SWITCH:
+        source = "start" if a == 0xFFFF else "thread %d" % a
+        return "%s -> thread %d" % (source, b)
+    if type == PAGE_FAULT:
+        cause = "protection" if a & 1 else "not present"
+        access = "write" if a & 2 else "read"
+        return "%s at 0x%08x (%s)" % (access, b, cause)
+    if type == DISK_ISSUE:
+        return "%s block %d" % ("write" if a else "read", b)
+    if type == DISK_COMPLETE:
+        if pending_disk is None:
+            return ""
+        return "%s block %d" % ("write" if pending_disk[2] else "read", pending_disk[3])
+    if type == FRAME_ALLOC:
+        return "%d frame(s) at %d" % (1 << a, b)
+    if type == FRAME_FREE:
+        return "frame %d" % b
+    return "a = %d, b = %d" % (a, b)
+
+
+def timeline(dump, hz, limit, show):
+    events = dump.events
+    print("TIMELINE: %d events (%d lost)" % (len(events), dump.lost_events))
+    if not events:
+        return
+    if dump.tick_cycles:
+        us_per_cycle = 1e6 / (hz * dump.tick_cycles)
+        unit = "us"
+    else:
+        us_per_cycle = 1.0
+        unit = "cycles"
+
+    start = events[0][0]
+    counts = {}
+    disk_times = []
+    pending_disk = None
+    lines = []
+    for e in events:
+        counts[e[1]] = counts.get(e[1], 0) + 1
+        text = describe(e, pending_disk)
+        if e[1] == DISK_ISSUE:
+            pending_disk = e
+        elif e[1] == DISK_COMPLETE and pending_disk is not None:
+            disk_times.append((e[0] - pending_disk[0]) * us_per_cycle)
+            text += ", after %.1f %s" % (disk_times[-1], unit)
+            pending_disk = None
+        lines.append("  %12.1f  %-15s %s"
+                     % ((e[0] - start) * us_per_cycle, EVENT_NAMES.get(e[1], "type %d" % e[1]), text))
+
+    for type in sorted(counts):
+        print("  %-15s %7d" % (EVENT_NAMES.get(type, "type %d" % type), counts[type]))
+    if disk_times:
+        print("  disk operations: avg %.1f %s, max %.1f %s"
+              % (sum(disk_times) / len(disk_times), unit, max(disk_times), unit))
+    if show:
+        print("  %12s  %-15s" % ("time (%s)" % unit, "event"))
+        for line in lines[-limit:]:
+            print(line)
+    print()
+
+# --------------------------------------------------------------------------
+# MAIN
+# --------------------------------------------------------------------------
+
+def main():
+    parser = argparse.ArgumentParser(description="Report on a kernel trace dump.")
+    parser.add_argument("dump", help="captured output of the debug port")
+    parser.add_argument("--map", help="linker map of the kernel (kernel.map)")
+    parser.add_argument("--hz", type=int, default=100,
+                        help="timer frequency of the kernel (default 100)")
+    parser.add_argument("--top", type=int, default=20,
+                        help="functions to show in the profile (default 20)")
+    parser.add_argument("--events", type=int, default=200,
+                        help="most recent events to list in the timeline (default 200)")
+    parser.add_argument("--summary", action="store_true",
+                        help="only count the events, do not list them")
+    args = parser.parse_args()
+
+    dumps = read_dumps(args.dump)
+    if not dumps:
+        sys.exit("no trace found in %s" % args.dump)
+    symbols = Symbols(args.map)
+    for i, dump in enumerate(dumps):
+        if len(dumps) > 1:
+            print("==== DUMP %d" % (i + 1))
+        flat_profile(dump, symbols, args.top)
+        timeline(dump, args.hz, args.events, not args.summary)
+
+
+if __name__ == "__main__":
+    main()